@@ -37,4 +37,11 @@ using FlushFileHandler = void (*)(std::span<const u8> buf,
 void SetGlobalFileWriteFunction(FlushFileHandler handler);
 void FlushFile(std::span<const u8> buf, std::string_view path);
 
+// Gather variant: writes |bufs| back to back without concatenating them first.
+using FlushFileVHandler = void (*)(std::span<const std::span<const u8>> bufs,
+                                   std::string_view path);
+void SetGlobalFileWriteVFunction(FlushFileVHandler handler);
+void FlushFileV(std::span<const std::span<const u8>> bufs,
+                std::string_view path);
+
 } // namespace oishii
@@ -0,0 +1,154 @@
+#include "hash.hxx"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+namespace oishii {
+
+namespace {
+
+constexpr u64 P1 = 11400714785074694791ull;
+constexpr u64 P2 = 14029467366897019727ull;
+constexpr u64 P3 = 1609587929392839161ull;
+constexpr u64 P4 = 9650029242287828579ull;
+constexpr u64 P5 = 2870177450012600261ull;
+
+template <typename T> inline T readLE(const u8* p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  if constexpr (std::endian::native == std::endian::big)
+    v = std::byteswap(v);
+  return v;
+}
+
+inline u64 xxhRound(u64 acc, u64 input) {
+  acc += input * P2;
+  acc = std::rotl(acc, 31);
+  return acc * P1;
+}
+
+inline u64 xxhMerge(u64 acc, u64 val) {
+  acc ^= xxhRound(0, val);
+  return acc * P1 + P4;
+}
+
+// Slice-by-8 tables for the reflected polynomial 0xEDB88320
+constexpr std::array<std::array<u32, 256>, 8> MakeCrcTables() {
+  std::array<std::array<u32, 256>, 8> t{};
+  for (u32 i = 0; i < 256; ++i) {
+    u32 c = i;
+    for (int k = 0; k < 8; ++k)
+      c = (c & 1) ? (c >> 1) ^ 0xEDB8'8320 : c >> 1;
+    t[0][i] = c;
+  }
+  for (u32 i = 0; i < 256; ++i)
+    for (int s = 1; s < 8; ++s)
+      t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+  return t;
+}
+constexpr auto sCrcTables = MakeCrcTables();
+
+} // namespace
+
+void Xxh64::reset(u64 seed) {
+  mSeed = seed;
+  mAcc[0] = seed + P1 + P2;
+  mAcc[1] = seed + P2;
+  mAcc[2] = seed;
+  mAcc[3] = seed - P1;
+  mTotal = 0;
+  mMemSize = 0;
+}
+
+void Xxh64::update(std::span<const u8> data) {
+  const u8* p = data.data();
+  const u8* const end = p + data.size();
+  mTotal += data.size();
+
+  // Top up a partial stripe first
+  if (mMemSize + data.size() < 32) {
+    if (!data.empty())
+      std::memcpy(mMem + mMemSize, p, data.size());
+    mMemSize += static_cast<u32>(data.size());
+    return;
+  }
+  if (mMemSize) {
+    const u32 fill = 32 - mMemSize;
+    std::memcpy(mMem + mMemSize, p, fill);
+    for (int i = 0; i < 4; ++i)
+      mAcc[i] = xxhRound(mAcc[i], readLE<u64>(mMem + i * 8));
+    p += fill;
+    mMemSize = 0;
+  }
+
+  // Four independent lanes: the compiler keeps these in registers
+  u64 v0 = mAcc[0], v1 = mAcc[1], v2 = mAcc[2], v3 = mAcc[3];
+  for (; p + 32 <= end; p += 32) {
+    v0 = xxhRound(v0, readLE<u64>(p));
+    v1 = xxhRound(v1, readLE<u64>(p + 8));
+    v2 = xxhRound(v2, readLE<u64>(p + 16));
+    v3 = xxhRound(v3, readLE<u64>(p + 24));
+  }
+  mAcc[0] = v0, mAcc[1] = v1, mAcc[2] = v2, mAcc[3] = v3;
+
+  if (p < end) {
+    mMemSize = static_cast<u32>(end - p);
+    std::memcpy(mMem, p, mMemSize);
+  }
+}
+
+u64 Xxh64::digest() const {
+  u64 h;
+  if (mTotal >= 32) {
+    h = std::rotl(mAcc[0], 1) + std::rotl(mAcc[1], 7) +
+        std::rotl(mAcc[2], 12) + std::rotl(mAcc[3], 18);
+    for (int i = 0; i < 4; ++i)
+      h = xxhMerge(h, mAcc[i]);
+  } else {
+    h = mSeed + P5;
+  }
+  h += mTotal;
+
+  const u8* p = mMem;
+  const u8* const end = mMem + mMemSize;
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxhRound(0, readLE<u64>(p));
+    h = std::rotl(h, 27) * P1 + P4;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<u64>(readLE<u32>(p)) * P1;
+    h = std::rotl(h, 23) * P2 + P3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= *p * P5;
+    h = std::rotl(h, 11) * P1;
+  }
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+void Crc32::update(std::span<const u8> data) {
+  const u8* p = data.data();
+  std::size_t n = data.size();
+  u32 c = mCrc;
+  const auto& t = sCrcTables;
+  for (; n >= 8; n -= 8, p += 8) {
+    const u32 lo = readLE<u32>(p) ^ c;
+    const u32 hi = readLE<u32>(p + 4);
+    c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+        t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+        t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+  }
+  for (; n; --n, ++p)
+    c = t[0][(c ^ *p) & 0xFF] ^ (c >> 8);
+  mCrc = c;
+}
+
+} // namespace oishii
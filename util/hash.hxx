@@ -0,0 +1,44 @@
+/*!
+ * @file
+ * @brief Streaming hashes for checksumming writer output.
+ */
+
+#pragma once
+
+#include <oishii/types.hxx>
+#include <span>
+
+namespace oishii {
+
+//! @brief Streaming XXH64 (xxHash, 64-bit). Output matches the reference
+//! implementation regardless of host endianness.
+//!
+class Xxh64 {
+public:
+  explicit Xxh64(u64 seed = 0) { reset(seed); }
+
+  void reset(u64 seed = 0);
+  void update(std::span<const u8> data);
+  u64 digest() const;
+
+private:
+  u64 mAcc[4];
+  u64 mSeed;
+  u64 mTotal;
+  u8 mMem[32];
+  u32 mMemSize;
+};
+
+//! @brief Streaming CRC-32 (IEEE 802.3, as used by zlib/PNG).
+//!
+class Crc32 {
+public:
+  void reset() { mCrc = 0xFFFF'FFFF; }
+  void update(std::span<const u8> data);
+  u32 digest() const { return ~mCrc; }
+
+private:
+  u32 mCrc = 0xFFFF'FFFF;
+};
+
+} // namespace oishii
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <bit>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "../util/util.hxx"
@@ -31,10 +34,12 @@ public:
       rsl::debug_break();
       abort();
     }
-    while (tell() + sizeof(T) > mBuf.size())
+    const u32 pos = physicalOffset(tell(), sizeof(T));
+    while (pos + sizeof(T) > mBuf.size())
       mBuf.push_back(0);
 
     breakPointProcess(sizeof(T));
+    logRewrite(sizeof(T));
 
     union {
       integral_t integral;
@@ -56,7 +61,7 @@ public:
     }
 #endif
 
-    *reinterpret_cast<integral_t*>(&mBuf[tell()]) = decoded;
+    *reinterpret_cast<integral_t*>(&mBuf[pos]) = decoded;
 
     seek<Whence::Current>(sizeof(T));
   }
@@ -72,10 +77,12 @@ public:
       rsl::debug_break();
       abort();
     }
-    while (tell() + sz > mBuf.size())
+    const u32 pos = physicalOffset(tell(), static_cast<u32>(sz));
+    while (pos + sz > mBuf.size())
       mBuf.push_back(0);
 
     u32 decoded = endianDecode<u32, E>(val);
+    logRewrite(static_cast<u32>(sz));
 
 #if 0
 #ifndef NDEBUG1
@@ -94,11 +101,51 @@ public:
 #endif
 #endif
     for (int i = 0; i < sz; ++i)
-      mBuf[tell() + i] = static_cast<u8>(decoded >> (8 * i));
+      mBuf[pos + i] = static_cast<u8>(decoded >> (8 * i));
 
     seek<Whence::Current>(sz);
   }
 
+  //! @brief Emit a payload by reference rather than copying it into the
+  //! buffer. The bytes are written out as-is (no endian conversion) when the
+  //! file is saved, or copied in if a contiguous buffer is requested.
+  //!
+  //! @param[in] data  Payload bytes. Must not change until the writer is done.
+  //! @param[in] owner Optional lifetime owner, held until the data is flushed
+  //!                  or materialized.
+  //!
+  void writeBorrowed(std::span<const u8> data,
+                     std::shared_ptr<const void> owner = nullptr) {
+    if (tell() + data.size() > 200'000'000) {
+      fprintf(stderr, "File size is astronomical");
+      rsl::debug_break();
+      abort();
+    }
+    breakPointProcess(static_cast<u32>(data.size()));
+
+    // Only appends can be borrowed; overwriting existing data falls back to a
+    // plain copy.
+    if (!appendBorrowed(data, std::move(owner))) {
+      logRewrite(static_cast<u32>(data.size()));
+      const u32 pos = physicalOffset(tell(), static_cast<u32>(data.size()));
+      if (pos + data.size() > mBuf.size())
+        mBuf.resize(pos + data.size());
+      std::copy(data.begin(), data.end(), mBuf.begin() + pos);
+    }
+    seek<Whence::Current>(static_cast<int>(data.size()));
+  }
+
+  //! Writes below `floor` touch data the linker has already verified, and are
+  //! logged so it can check them again.
+  //!
+  struct RewriteLog {
+    u32 floor = 0;
+    std::vector<std::pair<u32, u32>> entries; // [begin, end)
+  };
+  //! @brief Attach a log for the duration of a link; nullptr detaches.
+  //!
+  void setRewriteLog(RewriteLog* log) noexcept { mRewriteLog = log; }
+
   std::string mNameSpace = ""; // set by linker, stored in reservations
   std::string mBlockName = ""; // set by linker, stored in reservations
 
@@ -160,7 +207,7 @@ public:
     for (u32 i = 0; i < pad_end - pad_begin; ++i)
       this->write<u8>(0);
     if (mUserPad)
-      mUserPad(reinterpret_cast<char*>(getDataBlockStart()) + pad_begin,
+      mUserPad(reinterpret_cast<char*>(getInlinePtr(pad_begin)),
                pad_end - pad_begin);
   }
   using PadFunction = void (*)(char* dst, u32 size);
@@ -188,10 +235,27 @@ public:
     return start;
   }
 
-  void saveToDisk(std::string_view path) const { FlushFile(mBuf, path); }
+  void saveToDisk(std::string_view path) const {
+    if (mBorrowed.empty()) {
+      FlushFile(mBuf, path);
+      return;
+    }
+    std::vector<std::span<const u8>> pieces;
+    pieces.reserve(mBorrowed.size() * 2 + 1);
+    forEachSegment([&](u32, std::span<const u8> bytes) {
+      pieces.push_back(bytes);
+    });
+    FlushFileV(pieces, path);
+  }
 
 private:
+  void logRewrite(u32 size) {
+    if (mRewriteLog && tell() < mRewriteLog->floor)
+      mRewriteLog->entries.emplace_back(tell(), tell() + size);
+  }
+
   std::endian mFileEndian = std::endian::big; // to swap
+  RewriteLog* mRewriteLog = nullptr;
 };
 
 inline auto writePlaceholder(oishii::Writer& writer) {
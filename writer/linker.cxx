@@ -5,11 +5,14 @@
 
 #include "linker.hxx"
 
+#include "../util/hash.hxx"
 #include "binary_writer.hxx"
 #include "node.hxx"
 
 #include <algorithm>
+#include <cstring>
 #include <memory>
+#include <optional>
 #include <string>
 
 #include <core/common.h>
@@ -125,6 +128,144 @@ public:
     printf("Linker Error: Cannot resolve symbol \"%s\"!\n", symbol_.c_str());
     return 0xcccccccc;
   }
+  static std::optional<std::string> symbolOf(const Linker& linker,
+                                             const Hook& hook) {
+    if (!hook.mBlock)
+      return hook.mId;
+    for (const auto& entry : linker.mLayout)
+      if (entry.mNode.get() == hook.mBlock)
+        return entry.mNamespace.empty()
+                   ? entry.mNode->getId()
+                   : entry.mNamespace + "::" + entry.mNode->getId();
+    printf("Linker Error: Block %s was never written to stream, so canot "
+           "be resolved.\n",
+           hook.mBlock->getId().c_str());
+    return std::nullopt;
+  }
+  // Single pass over the output, feeding each byte to the file hash and to
+  // the hash of the block containing it (padding belongs to no block).
+  static void hashOutput(Linker& linker, const Writer& writer) {
+    auto& map = linker.mMap;
+    const bool doXxh = linker.mComputeXxh64, doCrc = linker.mComputeCrc32;
+    Xxh64 fileXxh, blockXxh;
+    Crc32 fileCrc, blockCrc;
+    std::size_t i = 0;
+
+    auto finishBlock = [&]() {
+      if (doXxh)
+        map[i].xxh64 = blockXxh.digest();
+      if (doCrc)
+        map[i].crc32 = blockCrc.digest();
+      blockXxh.reset();
+      blockCrc.reset();
+      ++i;
+    };
+    auto feed = [&](Xxh64& xxh, Crc32& crc, std::span<const u8> bytes) {
+      if (doXxh)
+        xxh.update(bytes);
+      if (doCrc)
+        crc.update(bytes);
+    };
+
+    writer.forEachSegment([&](u32 addr, std::span<const u8> bytes) {
+      feed(fileXxh, fileCrc, bytes);
+      const u32 end = addr + static_cast<u32>(bytes.size());
+      u32 pos = addr;
+      while (i < map.size()) {
+        const auto& entry = map[i];
+        if (entry.end <= pos) {
+          finishBlock();
+          continue;
+        }
+        if (entry.begin >= end)
+          break;
+        const u32 from = std::max<u32>(pos, entry.begin);
+        const u32 to = std::min<u32>(end, entry.end);
+        feed(blockXxh, blockCrc, bytes.subspan(from - addr, to - from));
+        pos = to;
+        if (to < entry.end)
+          break;
+      }
+    });
+    while (i < map.size())
+      finishBlock();
+
+    linker.mFileXxh64 = doXxh ? fileXxh.digest() : 0;
+    linker.mFileCrc32 = doCrc ? fileCrc.digest() : 0;
+  }
+
+  // Count bytes in [begin, end) that differ from the reference, recording the
+  // first few in |diffs| if supplied.
+  static std::size_t diffRange(const Writer& writer, u32 begin, u32 end,
+                               std::vector<Linker::ByteDiff>* diffs) {
+    const auto ref = writer.getVerificationReference();
+    std::size_t n = 0;
+    writer.forEachSegmentIn(begin, end, [&](u32 addr,
+                                            std::span<const u8> bytes) {
+      const std::size_t avail =
+          addr < ref.size() ? std::min(bytes.size(), ref.size() - addr) : 0;
+      if (avail == bytes.size() &&
+          std::memcmp(bytes.data(), ref.data() + addr, avail) == 0)
+        return;
+      for (std::size_t i = 0; i < bytes.size(); ++i) {
+        const s16 expected = i < avail ? ref[addr + i] : -1;
+        if (expected == bytes[i])
+          continue;
+        ++n;
+        if (diffs && diffs->size() < Linker::kMaxDiffs)
+          diffs->push_back({static_cast<u32>(addr + i), expected, bytes[i]});
+      }
+    });
+    return n;
+  }
+  // A stretch of output compared against the reference: a block or the
+  // padding the linker inserted around it.
+  struct Region {
+    std::string symbol;
+    u32 begin;
+    u32 end;
+  };
+  // Compare a freshly written block, skipping link placeholders (those
+  // reserved since |firstReservation|) as they are not yet resolved.
+  static bool blockMatches(const Region& block, const Writer& writer,
+                           std::size_t firstReservation) {
+    std::vector<std::pair<u32, u32>> holes;
+    for (std::size_t i = firstReservation; i < writer.mLinkReservations.size();
+         ++i) {
+      const auto& reserve = writer.mLinkReservations[i];
+      holes.emplace_back(reserve.addr, reserve.addr + reserve.TSize);
+    }
+    std::sort(holes.begin(), holes.end());
+    u32 pos = block.begin;
+    for (const auto& [from, to] : holes) {
+      if (from > pos && diffRange(writer, pos, from, nullptr))
+        return false;
+      pos = std::max(pos, to);
+    }
+    return pos >= block.end || !diffRange(writer, pos, block.end, nullptr);
+  }
+  // Call |f| with the index of every region overlapping [from, to). Regions
+  // are sorted and disjoint, so their ends are sorted too.
+  template <typename F>
+  static void forEachRegionIn(const std::vector<Region>& regions, u32 from,
+                              u32 to, F&& f) {
+    auto it = std::upper_bound(
+        regions.begin(), regions.end(), from,
+        [](u32 a, const Region& r) { return a < r.end; });
+    for (; it != regions.end() && it->begin < to; ++it)
+      f(it - regions.begin());
+  }
+};
+
+// Attaches a rewrite log to the writer for the duration of a link, detaching
+// it on every return path.
+struct ScopedRewriteLog {
+  ScopedRewriteLog(Writer& writer, Writer::RewriteLog* log) : mWriter(writer) {
+    mWriter.setRewriteLog(log);
+  }
+  ~ScopedRewriteLog() { mWriter.setRewriteLog(nullptr); }
+
+  Writer& mWriter;
 };
 
 struct EndOfChildrenMarker : public Node {
@@ -163,14 +304,42 @@ void Linker::shuffle() {
 
 void Linker::enforceRestrictions() {}
 
+void Linker::addChecksumField(const Hook& where, Checksum kind) {
+  mChecksumFields.push_back({where, kind});
+  if (kind == Checksum::Xxh64)
+    mComputeXxh64 = true;
+  else
+    mComputeCrc32 = true;
+}
+
 Result<void> Linker::write(Writer& writer, bool doShuffle) {
   if (doShuffle) {
     shuffle();
     enforceRestrictions();
   }
 
+  const bool verify = !writer.getVerificationReference().empty();
+  std::vector<LinkerHelper::Region> regions; // Compared against reference
+  std::vector<std::size_t> suspects;         // Regions to diff once linked
+  Writer::RewriteLog rewrites; // Writes into regions already compared
+  ScopedRewriteLog rewriteScope(writer, verify ? &rewrites : nullptr);
+  // Verify while the data is still hot in cache
+  auto verifyPad = [&](const std::string& symbol, bool before, u32 pad_begin) {
+    if (!verify || pad_begin == writer.tell())
+      return;
+    regions.push_back({(before ? "<pad before " : "<pad after ") + symbol + ">",
+                       pad_begin, writer.tell()});
+    if (LinkerHelper::diffRange(writer, pad_begin, writer.tell(), nullptr))
+      suspects.push_back(regions.size() - 1);
+  };
+
   // Write data
   for (const auto& entry : mLayout) {
+    const std::string symbol =
+        (entry.mNamespace.empty() ? "" : entry.mNamespace + "::") +
+        entry.mNode->getId();
+    // Anything written below here from now on revisits compared data
+    rewrites.floor = writer.tell();
     // align
     u32 alignment = entry.mNode->getLinkingRestriction().alignment;
     if (alignment) {
@@ -178,16 +347,17 @@ Result<void> Linker::write(Writer& writer, bool doShuffle) {
       while (writer.tell() % alignment)
         writer.write('F', false);
       if (pad_begin != writer.tell() && mUserPad)
-        mUserPad((char*)writer.getDataBlockStart() + pad_begin,
+        mUserPad((char*)writer.getInlinePtr(pad_begin),
                  writer.tell() - pad_begin);
+      verifyPad(symbol, true, pad_begin);
     }
     // Fill map: symbol and begin position
-    mMap.push_back({(entry.mNamespace.empty() ? "" : entry.mNamespace + "::") +
-                        entry.mNode->getId(),
-                    writer.tell(), 0, entry.mNode->getLinkingRestriction()});
+    mMap.push_back(
+        {symbol, writer.tell(), 0, entry.mNode->getLinkingRestriction()});
     // Write
     writer.mNameSpace = entry.mNamespace;
     writer.mBlockName = entry.mNode->getId();
+    const std::size_t firstReservation = writer.mLinkReservations.size();
     auto ok = entry.mNode->write2(writer);
     if (!ok) {
       return std::unexpected(
@@ -196,16 +366,25 @@ Result<void> Linker::write(Writer& writer, bool doShuffle) {
     }
     // Set ending position
     mMap[mMap.size() - 1].end = writer.tell();
+    if (verify && mMap.back().begin != mMap.back().end) {
+      regions.push_back({symbol, static_cast<u32>(mMap.back().begin),
+                         static_cast<u32>(mMap.back().end)});
+      if (!LinkerHelper::blockMatches(regions.back(), writer, firstReservation))
+        suspects.push_back(regions.size() - 1);
+    }
 
     if (entry.mNode->getLinkingRestriction().PadEnd && alignment) {
       auto pad_begin = writer.tell();
       while (writer.tell() % alignment)
         writer.write('F', false);
       if (pad_begin != writer.tell() && mUserPad)
-        mUserPad((char*)writer.getDataBlockStart() + pad_begin,
+        mUserPad((char*)writer.getInlinePtr(pad_begin),
                  writer.tell() - pad_begin);
+      verifyPad(symbol, false, pad_begin);
     }
   }
+  // Links and checksums are filled in below; log those writes too
+  rewrites.floor = 0xFFFF'FFFF;
 
   {
     printf("Begin    End      Size     Align    Static Leaf  Symbol\n");
@@ -248,39 +427,10 @@ Result<void> Linker::write(Writer& writer, bool doShuffle) {
                                               reserve.blockName, toBlockSymbol);
     // #endif
     //  TODO: Generalize all of these from/to methods
-    if (link.from.mBlock) {
-      bool bSuccess = false;
-      for (const auto& entry : mLayout) {
-        if (entry.mNode.get() == link.from.mBlock) {
-          fromBlockSymbol =
-              entry.mNamespace.empty()
-                  ? entry.mNode->getId()
-                  : entry.mNamespace + "::" + entry.mNode->getId();
-          bSuccess = true;
-          break;
-        }
-      }
-      if (!bSuccess)
-        printf("Linker Error: Block %s was never written to stream, so canot "
-               "be resolved.\n",
-               link.from.mBlock->getId().c_str());
-    }
-    if (link.to.mBlock) {
-      bool bSuccess = false;
-      for (const auto& entry : mLayout) {
-        if (entry.mNode.get() == link.to.mBlock) {
-          toBlockSymbol = entry.mNamespace.empty()
-                              ? entry.mNode->getId()
-                              : entry.mNamespace + "::" + entry.mNode->getId();
-          bSuccess = true;
-          break;
-        }
-      }
-      if (!bSuccess)
-        printf("Linker Error: Block %s was never written to stream, so canot "
-               "be resolved.\n",
-               link.to.mBlock->getId().c_str());
-    }
+    if (link.from.mBlock)
+      fromBlockSymbol = LinkerHelper::symbolOf(*this, link.from).value_or("");
+    if (link.to.mBlock)
+      toBlockSymbol = LinkerHelper::symbolOf(*this, link.to).value_or("");
     // TODO: Link: EndOfChildren + put that in map + if not all children static
     // and in shuffle, supply random number
     const u32 fromAddr = LinkerHelper::resolveHook(
@@ -311,6 +461,97 @@ Result<void> Linker::write(Writer& writer, bool doShuffle) {
     }
   }
 
+  // Resolve checksum fields
+  std::vector<u32> fieldAddrs;
+  for (const auto& field : mChecksumFields) {
+    const auto symbol = LinkerHelper::symbolOf(*this, field.mWhere);
+    const u32 addr = symbol ? LinkerHelper::resolveHook(*this, *symbol,
+                                                        field.mWhere.mRelation,
+                                                        field.mWhere.mOffset)
+                            : 0xcccccccc;
+    const u32 size = field.mKind == Checksum::Xxh64 ? 8 : 4;
+    if (addr == 0xcccccccc || addr + size > writer.endpos()) {
+      return std::unexpected(std::format(
+          "Cannot resolve checksum field {}",
+          field.mWhere.mBlock ? field.mWhere.mBlock->getId()
+                              : field.mWhere.mId));
+    }
+    fieldAddrs.push_back(addr);
+  }
+
+  // Hash
+  if (mComputeXxh64 || mComputeCrc32) {
+    // Cleared so the checksum does not cover itself
+    for (std::size_t i = 0; i < mChecksumFields.size(); ++i) {
+      writer.seekSet(fieldAddrs[i]);
+      writer.write<u32>(0, false);
+      if (mChecksumFields[i].mKind == Checksum::Xxh64)
+        writer.write<u32>(0, false);
+    }
+
+    LinkerHelper::hashOutput(*this, writer);
+
+    for (std::size_t i = 0; i < mChecksumFields.size(); ++i) {
+      writer.seekSet(fieldAddrs[i]);
+      if (mChecksumFields[i].mKind == Checksum::Crc32) {
+        writer.write<u32>(mFileCrc32);
+        continue;
+      }
+      const u32 hi = static_cast<u32>(mFileXxh64 >> 32);
+      const u32 lo = static_cast<u32>(mFileXxh64);
+      writer.write<u32>(writer.getIsBigEndian() ? hi : lo);
+      writer.write<u32>(writer.getIsBigEndian() ? lo : hi);
+    }
+  }
+
+  // Verify
+  if (verify) {
+    // Anything written into a region after it was compared (links,
+    // checksums, backpatches by later nodes) is checked again, as are regions
+    // that mismatched at the time.
+    for (const auto& [from, to] : rewrites.entries) {
+      LinkerHelper::forEachRegionIn(regions, from, to, [&](std::size_t i) {
+        suspects.push_back(i);
+      });
+    }
+    std::sort(suspects.begin(), suspects.end());
+    suspects.erase(std::unique(suspects.begin(), suspects.end()),
+                   suspects.end());
+
+    for (std::size_t i : suspects) {
+      Mismatch m;
+      m.symbol = regions[i].symbol;
+      m.begin = regions[i].begin;
+      m.end = regions[i].end;
+      m.numDiffs = LinkerHelper::diffRange(writer, regions[i].begin,
+                                           regions[i].end, &m.diffs);
+      if (m.numDiffs)
+        mMismatches.push_back(std::move(m));
+    }
+    for (const auto& m : mMismatches) {
+      printf("Matching violation in %s [0x%06x, 0x%06x): %u bytes differ\n",
+             m.symbol.c_str(), (u32)m.begin, (u32)m.end, (u32)m.numDiffs);
+      for (std::size_t i = 0; i < m.diffs.size() && i < 16; ++i) {
+        const auto& d = m.diffs[i];
+        if (d.expected < 0)
+          printf("  0x%06x: writing %02x past end of reference\n", d.addr,
+                 d.actual);
+        else
+          printf("  0x%06x: writing %02x where should be %02x\n", d.addr,
+                 d.actual, d.expected);
+      }
+    }
+
+    const auto ref = writer.getVerificationReference();
+    if (writer.endpos() != ref.size()) {
+      mMismatches.push_back(
+          {"<EOF>", std::min<std::size_t>(writer.endpos(), ref.size()),
+           std::max<std::size_t>(writer.endpos(), ref.size()), 0, {}});
+      printf("Matching violation: wrote 0x%06x bytes where should be 0x%06x\n",
+             writer.endpos(), (u32)ref.size());
+    }
+  }
+
   return {};
 }
 
@@ -58,6 +58,26 @@ public:
   using PadFunction = void (*)(char* dst, u32 size);
   PadFunction mUserPad = nullptr;
 
+  //! Hashes to compute over each block and the whole file after links are
+  //! resolved. Results are stored in mMap and mFileXxh64 / mFileCrc32.
+  //!
+  bool mComputeXxh64 = false;
+  bool mComputeCrc32 = false;
+
+  enum class Checksum { Xxh64, Crc32 };
+
+  //! @brief Store a checksum of the whole file at a hook once linked.
+  //!
+  //! @details The field (4 bytes for CRC32, 8 for XXH64, in file endian) is
+  //! zeroed before hashing, so mFileXxh64 / mFileCrc32 and the hash of the
+  //! containing block describe the file with its checksum fields cleared.
+  //! String hooks are looked up as fully namespaced symbols.
+  //!
+  //! @param[in] where Position of the field.
+  //! @param[in] kind  Checksum to store. Enables computing it.
+  //!
+  void addChecksumField(const Hook& where, Checksum kind);
+
 private:
   struct LayoutElement {
     std::unique_ptr<Node> mNode;
@@ -78,8 +98,43 @@ public:
     std::size_t end = 0;
 
     LinkingRestriction restrict; //!< Only for external use
+
+    u64 xxh64 = 0; //!< If mComputeXxh64
+    u32 crc32 = 0; //!< If mComputeCrc32
   };
   std::vector<MapEntry> mMap;
+
+  u64 mFileXxh64 = 0; //!< If mComputeXxh64
+  u32 mFileCrc32 = 0; //!< If mComputeCrc32
+
+  //! A byte that differs from the reference.
+  struct ByteDiff {
+    u32 addr;
+    s16 expected; //!< -1 if past the end of the reference
+    u8 actual;
+  };
+
+  //! A block that differs from the reference attached with
+  //! Writer::attachReferenceForVerification. Filled by write(). Linker padding
+  //! is reported as "<pad before X>" / "<pad after X>", and a difference in
+  //! file size as "<EOF>".
+  //!
+  struct Mismatch {
+    std::string symbol;
+    std::size_t begin = 0;
+    std::size_t end = 0;
+    std::size_t numDiffs = 0;
+    std::vector<ByteDiff> diffs; //!< The first kMaxDiffs differences
+  };
+  static constexpr std::size_t kMaxDiffs = 256;
+  std::vector<Mismatch> mMismatches;
+
+private:
+  struct ChecksumField {
+    Hook mWhere;
+    Checksum mKind;
+  };
+  std::vector<ChecksumField> mChecksumFields;
 };
 
 } // namespace oishii
@@ -6,8 +6,18 @@
 #include "node.hxx"
 #include "oishii/interfaces.hxx"
 
+#include <algorithm>
 #include <fstream>
 
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
 namespace oishii {
 
 Node::Result Node::gatherChildren([[maybe_unused]] NodeDelegate& mOut) const {
@@ -42,4 +52,70 @@ void FlushFile(std::span<const u8> buf, std::string_view path) {
   s_flushFileHandler(buf, path);
 }
 
+void OishiiDefaultFlushFileV(std::span<const std::span<const u8>> bufs,
+                             std::string_view path) {
+  // A user-supplied sink only understands contiguous buffers
+  if (s_flushFileHandler != OishiiDefaultFlushFile) {
+    std::vector<u8> flat;
+    for (auto buf : bufs)
+      flat.insert(flat.end(), buf.begin(), buf.end());
+    s_flushFileHandler(flat, path);
+    return;
+  }
+#ifdef _WIN32
+  std::ofstream stream(std::string(path), std::ios::binary | std::ios::out);
+  for (auto buf : bufs)
+    stream.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+#else
+  int fd;
+  do
+    fd = open(std::string(path).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  while (fd < 0 && errno == EINTR);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open %s for writing: %s\n",
+            std::string(path).c_str(), strerror(errno));
+    return;
+  }
+  std::vector<iovec> iov;
+  iov.reserve(bufs.size());
+  for (auto buf : bufs)
+    if (!buf.empty())
+      iov.push_back({const_cast<u8*>(buf.data()), buf.size()});
+
+  std::size_t i = 0;
+  while (i < iov.size()) {
+    const int n = static_cast<int>(std::min<std::size_t>(iov.size() - i,
+                                                         IOV_MAX));
+    const ssize_t written = writev(fd, &iov[i], n);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf(stderr, "Failed to write %s: %s\n", std::string(path).c_str(),
+              strerror(errno));
+      break;
+    }
+    // Advance past fully written vectors; trim a partially written one
+    std::size_t left = static_cast<std::size_t>(written);
+    while (i < iov.size() && left >= iov[i].iov_len)
+      left -= iov[i++].iov_len;
+    if (left) {
+      iov[i].iov_base = static_cast<u8*>(iov[i].iov_base) + left;
+      iov[i].iov_len -= left;
+    }
+  }
+  close(fd);
+#endif
+}
+FlushFileVHandler s_flushFileVHandler = OishiiDefaultFlushFileV;
+
+void SetGlobalFileWriteVFunction(FlushFileVHandler handler) {
+  s_flushFileVHandler = handler;
+}
+
+void FlushFileV(std::span<const std::span<const u8>> bufs,
+                std::string_view path) {
+  assert(s_flushFileVHandler != nullptr);
+  s_flushFileVHandler(bufs, path);
+}
+
 } // namespace oishii
@@ -2,19 +2,29 @@
 
 #include "../VectorStream.hxx"
 #include "../interfaces.hxx"
+#include <algorithm>
+#include <cstring>
 #include <memory>
+#include <span>
 #include <vector>
 
 namespace oishii {
 
 //! @brief Writer with expanding buffer.
 //!
+//! @details In addition to the inline buffer, large read-only payloads may be
+//! borrowed into the output instead of copied (see writeBorrowed). Stream
+//! positions are always logical file offsets; while borrowed segments exist,
+//! `mBuf` only holds the inline bytes and is NOT the file. Use the accessors
+//! below (which materialize on demand) when a contiguous buffer is required,
+//! rather than reading `mBuf` directly.
+//!
 class VectorWriter : public VectorStream {
 public:
   using VectorStream::VectorStream;
 
   // Bound check unlike reader -- can always extend file
-  bool isInBounds(u32 pos) { return pos < mBuf.size(); }
+  bool isInBounds(u32 pos) { return pos < endpos(); }
 
   void attachDataForMatchingOutput(const std::vector<u8>& data) {
 #ifndef NDEBUG
@@ -22,10 +32,173 @@ public:
 #endif
   }
 
+  //! @brief Borrow a reference file for block-level verification by the
+  //! linker (available in all builds). The data must outlive the link.
+  //!
+  void attachReferenceForVerification(std::span<const u8> data) {
+    mVerifyRef = data;
+  }
+  std::span<const u8> getVerificationReference() const noexcept {
+    return mVerifyRef;
+  }
+
+  //! A read-only payload referenced by the output rather than copied into it.
+  //!
+  struct BorrowedSegment {
+    u32 addr;                          //!< Logical address in the output.
+    u32 borrowedBefore;                //!< Borrowed bytes preceding this one.
+    std::span<const u8> data;          //!< Bytes, already in file byte order.
+    std::shared_ptr<const void> owner; //!< Keeps `data` alive. May be null.
+
+    u32 end() const { return addr + static_cast<u32>(data.size()); }
+  };
+
+  u32 endpos() const override {
+    return static_cast<u32>(mBuf.size()) + mBorrowedBytes;
+  }
+
+  bool hasBorrowedSegments() const noexcept { return !mBorrowed.empty(); }
+  const std::vector<BorrowedSegment>& getBorrowedSegments() const noexcept {
+    return mBorrowed;
+  }
+
+  //! @brief Copy all borrowed segments into the inline buffer, releasing their
+  //! owners. Afterwards `mBuf` is the full, contiguous file.
+  //!
+  void materialize() {
+    if (mBorrowed.empty())
+      return;
+    std::vector<u8> flat(endpos());
+    forEachSegment([&](u32 addr, std::span<const u8> bytes) {
+      std::memcpy(flat.data() + addr, bytes.data(), bytes.size());
+    });
+    mBuf = std::move(flat);
+    mBorrowed.clear();
+    mBorrowedBytes = 0;
+  }
+
+  //! @brief Invoke `f(addr, bytes)` for each contiguous piece of the output in
+  //! file order, alternating inline runs and borrowed segments. No copies.
+  //!
+  template <typename F> void forEachSegment(F&& f) const {
+    forEachSegmentIn(0, endpos(), f);
+  }
+
+  //! @brief As forEachSegment, restricted to the logical range [begin, end).
+  //!
+  template <typename F>
+  void forEachSegmentIn(u32 begin, u32 end, F&& f) const {
+    end = std::min(end, endpos());
+    // First segment ending after begin
+    auto it = std::upper_bound(
+        mBorrowed.begin(), mBorrowed.end(), begin,
+        [](u32 p, const BorrowedSegment& seg) { return p < seg.end(); });
+    u32 pos = begin;
+    while (pos < end) {
+      if (it == mBorrowed.end() || pos < it->addr) {
+        const u32 to = it == mBorrowed.end() ? end : std::min(end, it->addr);
+        const u32 phys =
+            pos - (it == mBorrowed.end() ? mBorrowedBytes : it->borrowedBefore);
+        f(pos, std::span<const u8>(mBuf.data() + phys, to - pos));
+        pos = to;
+      } else {
+        const u32 to = std::min(end, it->end());
+        f(pos, it->data.subspan(pos - it->addr, to - pos));
+        pos = to;
+        ++it;
+      }
+    }
+  }
+
+  // Contiguous access: these materialize borrowed segments first.
+  u8* getDataBlockStart() {
+    materialize();
+    return mBuf.data();
+  }
+  u32 getBufSize() {
+    materialize();
+    return static_cast<u32>(mBuf.size());
+  }
+  std::vector<u8>&& takeBuf() {
+    materialize();
+    return std::move(mBuf);
+  }
+  const u8* getStreamStart() {
+    materialize();
+    return mBuf.data();
+  }
+  const u8* getStreamStart() const {
+    // Cannot materialize here: the inline bytes are not the file
+    if (!mBorrowed.empty()) {
+      fprintf(stderr,
+              "getStreamStart() on a const writer with borrowed data\n");
+      rsl::debug_break();
+      abort();
+    }
+    return mBuf.data();
+  }
+
+  //! @brief Resize to a logical file size.
+  //!
+  void resize(u32 sz) {
+    // Truncating into a borrowed segment: copy it in first
+    if (!mBorrowed.empty() && sz < mBorrowed.back().end())
+      materialize();
+    mBuf.resize(physicalOffset(sz, 0));
+  }
+
+  //! @brief Pointer to inline byte at a logical address, without
+  //! materializing. The address must not fall within a borrowed segment.
+  //!
+  u8* getInlinePtr(u32 pos) { return mBuf.data() + physicalOffset(pos, 0); }
+
 protected:
+  //! @brief Append a borrowed segment at the current end of the stream.
+  //!
+  //! @return false if the stream is not positioned at its end, in which case
+  //! nothing was recorded.
+  //!
+  bool appendBorrowed(std::span<const u8> data,
+                      std::shared_ptr<const void> owner) {
+    if (tell() != endpos())
+      return false;
+    if (data.empty())
+      return true;
+    mBorrowed.push_back({tell(), mBorrowedBytes, data, std::move(owner)});
+    mBorrowedBytes += static_cast<u32>(data.size());
+    return true;
+  }
+
+  //! @brief Map a logical address to an offset in `mBuf`.
+  //!
+  //! @details If [pos, pos + size) overlaps a borrowed segment, the stream is
+  //! materialized so the write can proceed (copy-on-write).
+  //!
+  u32 physicalOffset(u32 pos, u32 size) {
+    if (mBorrowed.empty())
+      return pos;
+    // Fast path: past the last segment (the common case while appending)
+    if (pos >= mBorrowed.back().end())
+      return pos - mBorrowedBytes;
+    // First segment ending after pos
+    auto it = std::upper_bound(
+        mBorrowed.begin(), mBorrowed.end(), pos,
+        [](u32 p, const BorrowedSegment& seg) { return p < seg.end(); });
+    if (pos + size > it->addr) {
+      materialize();
+      return pos;
+    }
+    return pos - it->borrowedBefore;
+  }
+
 #ifndef NDEBUG
   std::vector<u8> mDebugMatch;
 #endif
+
+  std::span<const u8> mVerifyRef;
+
+  std::vector<BorrowedSegment> mBorrowed; // Sorted by address
+  u32 mBorrowedBytes = 0;
 };
 
 } // namespace oishii